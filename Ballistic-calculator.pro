@@ -15,7 +15,10 @@ SOURCES += \
     mainwindow.cpp
 
 HEADERS += \
-    mainwindow.h
+    drag.h \
+    mainwindow.h \
+    terrain.h \
+    worker.h
 
 FORMS += \
     mainwindow.ui
@@ -3,7 +3,13 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 #include <Q3DScatter>
+#include "terrain.h"
+#include "drag.h"
 
 
 const float PI = 3.1415;
@@ -122,40 +128,112 @@ float deg_to_rad(float deg){
 const static AVec G = AVec(0.0, 0.0, -9.81);
 
 struct Simulation{
-    QScatterDataArray data;
+    QScatterDataArray data; // разделяет данные с буфером из пула trajectory_buffer(), см. ниже
     float z_max;
     AVec v_end;
 };
 
-AVec diff_velocity(AVec v, AVec u, float mu, float m){
+// drag - закон сопротивления Cd(Мах), nullptr - постоянный коэффициент mu
+AVec diff_velocity(AVec v, AVec u, float mu, float m, const DragCurve *drag=nullptr){
     AVec v_ = v + u*(-1);
-    return G + v_*(-mu*v_.length()/m);
+    float speed = v_.length();
+    float k = (drag == nullptr) ? mu : mu*drag->cd(speed);
+    return G + v_*(-k*speed/m);
 }
 
-Simulation compute(Vec v0, Vec u0, float mu, float m, float dt, float h0, float h_end=0){
+// Оценка времени полета без сопротивления воздуха (по вертикальной составляющей скорости).
+// Используется только для предварительного выделения памяти под траекторию. Это не граница:
+// сопротивление замедляет снижение и полет может быть дольше, тогда буфер просто дорастет
+float estimate_flight_time(float vz, float h0, float h_end){
+    float g = -G.z;
+    float z_top = (vz > 0) ? h0 + vz*vz/(2*g) : h0;
+    float h_stop = (z_top > h_end) ? std::max(h_end, 0.0f) : 0.0f;
+    // Больший корень уравнения h0 + vz*t - g*t^2/2 = h_stop
+    float d = vz*vz + 2*g*std::max(h0 - h_stop, 0.0f);
+    return (vz + sqrt(d)) / g;
+}
+
+// Пул буферов траекторий (свой для каждого потока). Результат compute() и серии графика
+// разделяют буфер за счет неявного разделения данных Qt (без копирования точек); буфер
+// становится свободным, когда удалены все его копии. Память буферов между запусками не освобождается,
+// поэтому в установившемся режиме compute() ничего не выделяет
+QScatterDataArray *trajectory_buffer(int capacity){
+    thread_local std::deque<QScatterDataArray> pool; // deque не перемещает элементы при росте
+    QScatterDataArray *buf = nullptr;
+    for (auto &b : pool){
+        if (b.capacity() == 0 || b.isDetached()){
+            buf = &b;
+            break;
+        }
+    }
+    if (buf == nullptr){
+        pool.emplace_back();
+        buf = &pool.back();
+    }
+    buf->resize(0); // resize(0), в отличие от новой аллокации, сохраняет емкость буфера
+    if (buf->capacity() < capacity){
+        buf->reserve(capacity);
+    }
+    return buf;
+}
+
+// Шаг траектории r_prev -> r пересек рельеф: переносим r в точку пересечения
+bool hit_terrain(const Terrain *terrain, P r_prev, P &r){
+    float t;
+    if (terrain == nullptr || !terrain->intersect(r_prev.x, r_prev.y, r_prev.z, r.x, r.y, r.z, t)){
+        return false;
+    }
+    r = r_prev + Vec(r_prev, r).to_avec()*t;
+    return true;
+}
+
+// Условие продолжения полета: над рельефом (если он задан) или над плоскостью z = 0.
+// Высота h_end учитывается в обоих случаях; с рельефом h_end = -INFINITY отключает ее
+bool in_flight(const Terrain *terrain, bool hit, P r, float h_end, bool cannot_bump){
+    if (terrain != nullptr){
+        return !hit && r.z >= terrain->min_height() && (r.z > h_end || cannot_bump);
+    }
+    return (r.z > 0.0) && (r.z > h_end || cannot_bump);
+}
+
+// С рельефом высоты h0 и h_end отсчитываются от уровня земли в точке стрельбы (0, 0)
+float ground_level(const Terrain *terrain){
+    return (terrain != nullptr) ? terrain->height_at(0, 0) : 0.0f;
+}
+
+Simulation compute(Vec v0, Vec u0, float mu, float m, float dt, float h0, float h_end=0, const Terrain *terrain=nullptr, const DragCurve *drag=nullptr,
+                   const std::atomic<bool> *cancel=nullptr){ // cancel - флаг досрочной остановки (фоновый расчет)
+    h0 += ground_level(terrain);
+    h_end += ground_level(terrain);
     P r = P(0, 0, h0);
+    P r_prev;
+    bool hit = false;
     AVec k0, k1, k2, k3;
     AVec v = v0.to_avec();
     AVec q0, q1, q2, q3;
     AVec u = u0.to_avec();
-    QScatterDataArray data;
+    // Запас 25% на сопротивление; при dt <= 0 (или огромном числе шагов) не выделяем заранее
+    float steps = 1.25f*estimate_flight_time(v.z, h0, h_end)/dt;
+    QScatterDataArray &data = *trajectory_buffer((steps >= 0 && steps < 1e7f) ? int(steps) + 2 : 0);
     float z_max = 0;
     bool cannot_bump=true;
 
     do{
         // Метод Рунге-Кутты 4 порядка
+        r_prev = r;
         k0 = v;
-        q0 = diff_velocity(k0, u, mu, m);
+        q0 = diff_velocity(k0, u, mu, m, drag);
         k1 = v + q0*(dt/2);
-        q1 = diff_velocity(k1, u, mu, m);
+        q1 = diff_velocity(k1, u, mu, m, drag);
         k2 = v + q1*(dt/2);
-        q2 = diff_velocity(k2, u, mu, m);
+        q2 = diff_velocity(k2, u, mu, m, drag);
         k3 = v + q2*(dt);
-        q3 = diff_velocity(k3, u, mu, m);
+        q3 = diff_velocity(k3, u, mu, m, drag);
 
         // Вычисляем новое значение скорости и радиус вектора
         v = v + (q0 + q1*2 + q2*2 + q3)*(dt/6);
         r = r + (k0 + k1*2 + k2*2 + k3)*(dt/6);
+        hit = hit_terrain(terrain, r_prev, r);
 
         data << QVector3D(r.x, r.z, r.y); // Особенности Q3DScatter (y -> z)
 
@@ -167,7 +245,7 @@ Simulation compute(Vec v0, Vec u0, float mu, float m, float dt, float h0, float
             cannot_bump = false;
         }
 
-    } while((r.z > 0.0) && (r.z > h_end || cannot_bump));
+    } while(in_flight(terrain, hit, r, h_end, cannot_bump) && !(cancel != nullptr && *cancel));
 
     return Simulation{data, z_max, v};
 }
@@ -180,6 +258,8 @@ struct ext_params{
     float dt;
     float h0;
     float h_end;
+    const Terrain *terrain; // nullptr - плоская земля
+    const DragCurve *drag;  // nullptr - постоянный коэффициент mu
 };
 struct grad_params{
     float da;
@@ -189,35 +269,47 @@ struct grad_params{
     long maxiter=2000;
 };
 
-// Функция вычисляет отклонение от целевой точки при заданных параметрах броска
-float target_error(float v0, float alpha, float beta, P target, ext_params ep){
+// Функция вычисляет точку падения при заданных параметрах броска
+P impact_point(float v0, float alpha, float beta, ext_params ep,
+               const std::atomic<bool> *cancel=nullptr){ // cancel - как в compute
+    ep.h0 += ground_level(ep.terrain);
+    ep.h_end += ground_level(ep.terrain);
     P r = P(0, 0, ep.h0);
     AVec k0, k1, k2, k3;
     AVec v = Vec(v0, alpha, beta).to_avec();
     AVec q0, q1, q2, q3;
     AVec u = ep.u.to_avec();
     bool cannot_bump=true;
+    P r_prev;
+    bool hit = false;
 
     do{
         // Метод Рунге-Кутты 4 порядка
+        r_prev = r;
         k0 = v;
-        q0 = diff_velocity(k0, u, ep.mu, ep.m);
+        q0 = diff_velocity(k0, u, ep.mu, ep.m, ep.drag);
         k1 = v + q0*(ep.dt/2);
-        q1 = diff_velocity(k1, u, ep.mu, ep.m);
+        q1 = diff_velocity(k1, u, ep.mu, ep.m, ep.drag);
         k2 = v + q1*(ep.dt/2);
-        q2 = diff_velocity(k2, u, ep.mu, ep.m);
+        q2 = diff_velocity(k2, u, ep.mu, ep.m, ep.drag);
         k3 = v + q2*(ep.dt);
-        q3 = diff_velocity(k3, u, ep.mu, ep.m);
+        q3 = diff_velocity(k3, u, ep.mu, ep.m, ep.drag);
 
         // Вычисляем новое значение скорости и радиус вектора
         v = v + (q0 + q1*2 + q2*2 + q3)*(ep.dt/6);
         r = r + (k0 + k1*2 + k2*2 + k3)*(ep.dt/6);
+        hit = hit_terrain(ep.terrain, r_prev, r);
 
         if (r.z > ep.h_end){
             cannot_bump = false;
         }
-    } while((r.z > 0.0) && (r.z > ep.h_end || cannot_bump));
-    return r.distance_xy(target);
+    } while(in_flight(ep.terrain, hit, r, ep.h_end, cannot_bump) && !(cancel != nullptr && *cancel));
+    return r;
+}
+
+// Функция вычисляет отклонение от целевой точки при заданных параметрах броска
+float target_error(float v0, float alpha, float beta, P target, ext_params ep){
+    return impact_point(v0, alpha, beta, ep).distance_xy(target);
 }
 
 // Реализация алгоритма градиентного спуска для действительной функции от 2-х переменных
@@ -280,6 +372,196 @@ QScatterDataArray grid_target_error(float alpha_min, float alpha_max, float beta
     return grid;
 }
 
+// Зона досягаемости огневой позиции: для каждого азимута строим зависимость дальности от угла возвышения
+// и находим угол максимальной дальности. Азимуты независимы, поэтому считаются параллельно.
+// По точкам падения строится карта досягаемости на плоскости XY с мертвыми зонами
+
+struct coverage_return{
+    int azimuth_bins;
+    std::vector<float> alphas;     // углы возвышения выборки
+    std::vector<float> ranges;     // дальность(угол возвышения) по азимутам: ranges[i*alphas.size() + j]
+    std::vector<float> min_range;  // минимальная и максимальная досягаемая дальность по азимутам
+    std::vector<float> max_range;
+    std::vector<float> best_alpha; // угол максимальной дальности по азимутам
+    QScatterDataArray envelope;    // замкнутый контур максимальной дальности
+    // Карта досягаемости: cells x cells ячеек размера cell с центром в точке стрельбы.
+    // 0 - вне контура, 1 - досягаемо, 2 - мертвая зона (внутри контура, но недосягаемо)
+    int cells;
+    float cell;
+    std::vector<unsigned char> heatmap;
+};
+
+// Уточнение угла максимальной дальности методом золотого сечения на отрезке [a, b]
+float max_range_alpha(float a, float b, float v0, float beta, ext_params ep, const std::atomic<bool> *cancel=nullptr){
+    const float k = 0.618034f;
+    float x1 = b - (b - a)*k, x2 = a + (b - a)*k;
+    float f1 = impact_point(v0, x1, beta, ep, cancel).distance_xy(P()), f2 = impact_point(v0, x2, beta, ep, cancel).distance_xy(P());
+    for (int i = 0; i < 20; i++){
+        if (f1 < f2){
+            a = x1; x1 = x2; f1 = f2;
+            x2 = a + (b - a)*k;
+            f2 = impact_point(v0, x2, beta, ep, cancel).distance_xy(P());
+        } else {
+            b = x2; x2 = x1; f2 = f1;
+            x1 = b - (b - a)*k;
+            f1 = impact_point(v0, x1, beta, ep, cancel).distance_xy(P());
+        }
+    }
+    return (a + b)/2;
+}
+
+// Участок кривой точек падения между соседними углами возвышения. Если точки падения
+// расходятся больше чем на tol, делим угол пополам; если и на глубине depth разрыв остается,
+// это разрыв дальности (снаряд цепляет рельеф или не добирается до h_end) - точки не соединяются
+void impact_segments(float a0, P r0, float a1, P r1, float v0, float beta, ext_params ep, float tol, int depth,
+                     std::vector<std::pair<P, P>> &segments, const std::atomic<bool> *cancel=nullptr){
+    float gap = Vec(r0, r1).length();
+    if (gap <= tol){
+        segments.push_back({r0, r1});
+        return;
+    }
+    if (depth == 0 || (cancel != nullptr && *cancel)){
+        segments.push_back({r0, r0});
+        segments.push_back({r1, r1});
+        return;
+    }
+    float am = (a0 + a1)/2;
+    P rm = impact_point(v0, am, beta, ep, cancel);
+    impact_segments(a0, r0, am, rm, v0, beta, ep, tol, depth - 1, segments, cancel);
+    impact_segments(am, rm, a1, r1, v0, beta, ep, tol, depth - 1, segments, cancel);
+}
+
+// Проверка точки на попадание внутрь многоугольника (метод лучей)
+bool inside_polygon(const std::vector<P> &poly, float x, float y){
+    bool inside = false;
+    for (size_t k = 0, l = poly.size() - 1; k < poly.size(); l = k++){
+        if ((poly[k].y > y) != (poly[l].y > y) &&
+            x < (poly[l].x - poly[k].x)*(y - poly[k].y)/(poly[l].y - poly[k].y) + poly[k].x){
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+coverage_return coverage(int azimuth_bins, float alpha_min, float alpha_max, float alpha_step, float v0, ext_params ep, std::function<void(int)> progress,
+                         const std::atomic<bool> *cancel=nullptr){
+    int alpha_bins = std::max(1, int((alpha_max - alpha_min)/alpha_step) + 1);
+    // Без рельефа и с h_end не выше орудия дальность непрерывна по углу, разрывы искать не нужно
+    bool continuous = ep.terrain == nullptr && ep.h_end <= ep.h0;
+    std::vector<P> impacts(size_t(azimuth_bins)*alpha_bins);
+    std::vector<P> best(azimuth_bins);
+    std::vector<std::vector<std::pair<P, P>>> segments(azimuth_bins);
+    int cells = std::max(2, azimuth_bins/4); // размер ячейки карты не меньше шага между азимутами
+    coverage_return res;
+    res.azimuth_bins = azimuth_bins;
+    res.alphas.resize(alpha_bins);
+    for (int j = 0; j < alpha_bins; j++){
+        res.alphas[j] = std::min(alpha_min + j*alpha_step, alpha_max);
+    }
+    res.ranges.resize(impacts.size());
+    res.min_range.resize(azimuth_bins);
+    res.max_range.resize(azimuth_bins);
+    res.best_alpha.resize(azimuth_bins);
+
+    std::atomic<int> next(0);
+    auto worker = [&](bool report){
+        for (int i = next++; i < azimuth_bins; i = next++){
+            if (cancel != nullptr && *cancel){
+                return;
+            }
+            float beta = -PI + 2*PI*i/azimuth_bins;
+            P *row = &impacts[size_t(i)*alpha_bins];
+            float *range_row = &res.ranges[size_t(i)*alpha_bins];
+            int j_best = 0;
+            for (int j = 0; j < alpha_bins; j++){
+                row[j] = impact_point(v0, res.alphas[j], beta, ep, cancel);
+                range_row[j] = row[j].distance_xy(P());
+                if (range_row[j] > range_row[j_best]){
+                    j_best = j;
+                }
+            }
+            if (cancel != nullptr && *cancel){
+                return;
+            }
+            float a = std::max(alpha_min, alpha_min + (j_best - 1)*alpha_step);
+            float b = std::min(alpha_max, alpha_min + (j_best + 1)*alpha_step);
+            res.best_alpha[i] = max_range_alpha(a, b, v0, beta, ep, cancel);
+            best[i] = impact_point(v0, res.best_alpha[i], beta, ep, cancel);
+            // Уточнение может попасть хуже узла сетки (разрыв дальности на рельефе): берем точку,
+            // которая действительно дает максимум, - по ней же строятся контур и мертвые зоны
+            if (!(best[i].distance_xy(P()) > range_row[j_best])){
+                res.best_alpha[i] = res.alphas[j_best];
+                best[i] = row[j_best];
+            }
+            res.max_range[i] = best[i].distance_xy(P());
+            res.min_range[i] = *std::min_element(range_row, range_row + alpha_bins);
+
+            // Разрывы ищем с точностью до ячейки карты досягаемости (меньшие на карте не видны)
+            float tol = continuous ? INFINITY : 2*res.max_range[i]/cells;
+            segments[i].push_back({row[0], row[0]});
+            for (int j = 0; j + 1 < alpha_bins; j++){
+                impact_segments(res.alphas[j], row[j], res.alphas[j + 1], row[j + 1], v0, beta, ep, tol, 6, segments[i], cancel);
+            }
+            if (report){ // прогресс сообщает только вызывающий поток
+                progress(int(float(std::min(int(next), azimuth_bins))/azimuth_bins*100));
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    int n_threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    for (int t = 0; t < n_threads; t++){
+        threads.emplace_back(worker, false);
+    }
+    worker(true);
+    for (auto &t : threads){
+        t.join();
+    }
+    if (cancel != nullptr && *cancel){
+        return res;
+    }
+
+    res.envelope.reserve(azimuth_bins + 1);
+    for (const P &r : best){
+        res.envelope << QVector3D(r.x, r.z, r.y); // Особенности Q3DScatter (y -> z)
+    }
+    res.envelope << QVector3D(best[0].x, best[0].z, best[0].y); // замыкаем контур
+
+    // Карта досягаемости: отмечаем ячейки, через которые проходят непрерывные участки кривых точек падения
+    float r_max = 0;
+    for (const P &r : best){
+        r_max = std::max(r_max, std::max(std::abs(r.x), std::abs(r.y)));
+    }
+    res.cells = cells;
+    res.cell = std::max(2*r_max/res.cells, 1e-3f);
+    res.heatmap.assign(size_t(res.cells)*res.cells, 0);
+    auto mark = [&](float x, float y){
+        int cx = int(std::floor(x/res.cell + res.cells/2.0f));
+        int cy = int(std::floor(y/res.cell + res.cells/2.0f));
+        if (cx >= 0 && cy >= 0 && cx < res.cells && cy < res.cells){
+            res.heatmap[size_t(cy)*res.cells + cx] = 1;
+        }
+    };
+    for (const auto &row : segments){
+        for (const auto &seg : row){
+            float dx = seg.second.x - seg.first.x, dy = seg.second.y - seg.first.y;
+            int n = int(std::ceil(2*sqrt(dx*dx + dy*dy)/res.cell));
+            for (int k = 0; k <= n; k++){
+                float t = (n == 0) ? 0 : float(k)/n;
+                mark(seg.first.x + dx*t, seg.first.y + dy*t);
+            }
+        }
+    }
+    for (int cy = 0; cy < res.cells; cy++){
+        for (int cx = 0; cx < res.cells; cx++){
+            unsigned char &c = res.heatmap[size_t(cy)*res.cells + cx];
+            if (c == 0 && inside_polygon(best, (cx + 0.5f - res.cells/2.0f)*res.cell, (cy + 0.5f - res.cells/2.0f)*res.cell)){
+                c = 2;
+            }
+        }
+    }
+    return res;
+}
+
 
 
 
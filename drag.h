@@ -0,0 +1,126 @@
+#ifndef DRAG_H
+#define DRAG_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QString>
+#include <QTextStream>
+#include <QStringList>
+
+// Закон сопротивления: коэффициент Cd в зависимости от числа Маха.
+// При загрузке кривая пересчитывается в равномерную таблицу по скорости, поэтому
+// вычисление на шаге интегрирования - одно умножение и линейная интерполяция
+// (без поиска по таблице и трансцендентных функций).
+// Сила сопротивления: mu * Cd(v) * v^2, для постоянного закона Cd = 1 (прежняя модель).
+class DragCurve{
+public:
+    QString name;
+
+    DragCurve(){
+        std::vector<float> mach{0.0f}, cd{1.0f};
+        resample(mach, cd);
+    }
+    DragCurve(QString name, const std::vector<float> &mach, const std::vector<float> &cd) : name(name){
+        resample(mach, cd);
+    }
+
+    // Cd при скорости speed (м/с) относительно воздуха
+    float cd(float speed) const {
+        float x = speed*inv_step;
+        if (!(x < last)){ // в том числе NaN: int(NaN) - неопределенное поведение
+            return table.back();
+        }
+        int i = int(x);
+        float f = x - i;
+        return table[i] + (table[i+1] - table[i])*f;
+    }
+
+    static DragCurve constant(){
+        DragCurve c;
+        c.name = "Постоянный (μ·v²)";
+        return c;
+    }
+
+    // Стандартные законы сопротивления (узлы таблиц G1 и G7)
+    static DragCurve g1(){
+        return DragCurve("G1",
+            {0.00f, 0.20f, 0.40f, 0.50f, 0.60f, 0.70f, 0.80f, 0.85f, 0.90f, 0.95f, 1.00f, 1.05f, 1.10f, 1.15f, 1.20f,
+             1.30f, 1.40f, 1.50f, 1.60f, 1.80f, 2.00f, 2.20f, 2.40f, 2.60f, 2.80f, 3.00f, 3.50f, 4.00f, 5.00f},
+            {0.2629f, 0.2344f, 0.2104f, 0.2032f, 0.2034f, 0.2165f, 0.2546f, 0.2901f, 0.3415f, 0.4084f, 0.4805f, 0.5427f, 0.5883f, 0.6191f, 0.6393f,
+             0.6589f, 0.6625f, 0.6573f, 0.6474f, 0.6210f, 0.5934f, 0.5685f, 0.5481f, 0.5325f, 0.5211f, 0.5133f, 0.5040f, 0.5006f, 0.4988f});
+    }
+
+    static DragCurve g7(){
+        return DragCurve("G7",
+            {0.00f, 0.50f, 0.70f, 0.80f, 0.85f, 0.90f, 0.925f, 0.95f, 0.975f, 1.00f, 1.025f, 1.05f, 1.10f, 1.20f, 1.30f,
+             1.40f, 1.50f, 1.60f, 1.80f, 2.00f, 2.20f, 2.40f, 2.60f, 2.80f, 3.00f, 3.50f, 4.00f, 5.00f},
+            {0.1198f, 0.1194f, 0.1202f, 0.1242f, 0.1306f, 0.1464f, 0.1660f, 0.2054f, 0.2993f, 0.3803f, 0.4015f, 0.4043f, 0.4014f, 0.3884f, 0.3732f,
+             0.3580f, 0.3440f, 0.3315f, 0.3117f, 0.2980f, 0.2864f, 0.2752f, 0.2643f, 0.2533f, 0.2424f, 0.2154f, 0.1935f, 0.1618f});
+    }
+
+    // Пользовательская кривая: текстовый файл, в каждой строке "Мах Cd" (строки с # пропускаются)
+    static bool from_file(const QString &path, DragCurve &curve){
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)){
+            return false;
+        }
+        std::vector<float> mach, cd;
+        QTextStream in(&file);
+        while (!in.atEnd()){
+            QString line = in.readLine().trimmed();
+            if (line.isEmpty() || line.startsWith("#")){
+                continue;
+            }
+            QStringList parts = line.split(QRegularExpression("[\\s;,]+"));
+            bool ok_m = false, ok_cd = false;
+            float m = parts.size() == 2 ? parts[0].toFloat(&ok_m) : 0;
+            float c = parts.size() == 2 ? parts[1].toFloat(&ok_cd) : 0;
+            // toFloat принимает "nan" и "inf", поэтому конечность проверяется отдельно
+            if (!ok_m || !ok_cd || !std::isfinite(m) || !std::isfinite(c) || m < 0 || c < 0 ||
+                (!mach.empty() && m <= mach.back())){
+                return false;
+            }
+            mach.push_back(m);
+            cd.push_back(c);
+        }
+        if (mach.empty()){
+            return false;
+        }
+        curve = DragCurve(QFileInfo(path).baseName(), mach, cd);
+        return true;
+    }
+
+private:
+    constexpr static float sound_speed = 340.3f; // м/с, у земли
+    constexpr static int table_size = 1024;
+    std::vector<float> table;
+    float inv_step;
+    float last;
+
+    void resample(const std::vector<float> &mach, const std::vector<float> &cd){
+        float v_max = std::max(mach.back(), 1.0f)*sound_speed;
+        float step = v_max/(table_size - 1);
+        inv_step = 1/step;
+        last = table_size - 1;
+        table.resize(table_size);
+        size_t k = 0;
+        for (int i = 0; i < table_size; i++){
+            float m = i*step/sound_speed;
+            while (k + 1 < mach.size() && mach[k + 1] <= m){
+                k++;
+            }
+            if (k + 1 >= mach.size() || m <= mach[k]){
+                table[i] = cd[k];
+            } else {
+                float f = (m - mach[k])/(mach[k + 1] - mach[k]);
+                table[i] = cd[k] + (cd[k + 1] - cd[k])*f;
+            }
+        }
+    }
+};
+
+#endif // DRAG_H
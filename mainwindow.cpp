@@ -5,6 +5,8 @@
 #include <QRegExp>
 #include <Q3DScatter>
 #include <QTimer>
+#include <QFileDialog>
+#include <QMessageBox>
 #include <cmath>
 
 MainWindow::MainWindow(QWidget *parent)
@@ -20,6 +22,18 @@ MainWindow::MainWindow(QWidget *parent)
     chart->setHorizontalAspectRatio(1.0);
     chart->setShadowQuality(QAbstract3DGraph::ShadowQualityNone); // отключаем тени
     chart->show();
+
+    // Законы сопротивления: последний пункт списка - загрузка своей кривой
+    drag_curves = {DragCurve::constant(), DragCurve::g1(), DragCurve::g7()};
+    for (const DragCurve &c : drag_curves){
+        ui->edt_drag->addItem(c.name);
+    }
+    ui->edt_drag->addItem("Из файла...");
+
+    preview_timer = new QTimer(this);
+    preview_timer->setSingleShot(true);
+    preview_timer->setInterval(16); // не чаще одного пересчета за кадр (~60 Гц)
+    connect(preview_timer, &QTimer::timeout, this, [this]() { preview(); });
 }
 
 MainWindow::~MainWindow()
@@ -34,6 +48,8 @@ void MainWindow::on_pushButton_start_clicked()
 }
 
 void MainWindow::start(bool from_gui_inputs){
+    cancel_coverage();
+    cancel_preview();
     target_x = ui->edt_target_x->text().toFloat();
     target_y = ui->edt_target_y->text().toFloat();
     target_h = ui->edt_target_h->text().toFloat();
@@ -61,22 +77,21 @@ void MainWindow::start(bool from_gui_inputs){
         m = params_list[7].toFloat();
         dt = params_list[8].toFloat();
     }
+    if (!check_dt()){
+        return;
+    }
 
     Vec v = Vec(v0, alpha, beta);
     Vec u = Vec(u_value, 0.0, gamma);
 
-    float h_end;
-    if (ui->btn_is_user_h->isChecked()){
-        h_end = target_h;
-    } else{
-        h_end = 0.0f;
-    }
+    float h_end = get_h_end();
 
     ui->progressBar->setValue(10); // progressBar
 
-    Simulation result = compute(v, u, mu, m, dt, h0, h_end);
-    P end = P(result.data.back().x(), result.data.back().z(), 0.0);
+    Simulation result = compute(v, u, mu, m, dt, h0, h_end, terrain.get(), get_drag());
+    P end = P(result.data.constLast().x(), result.data.constLast().z(), 0.0);
     if (ui->btn_is_user_h->isChecked()){end.z = target_h;}
+    if (terrain != nullptr){end.z = result.data.constLast().y() - ground_level(terrain.get());} // высота над точкой стрельбы
     AVec v_end = result.v_end;
     float alpha_end = asin(abs(v_end.z/v_end.length()));
 
@@ -89,18 +104,20 @@ void MainWindow::start(bool from_gui_inputs){
     ui->label_v_end->setText(QString::number(result.v_end.length(), 'f', 1));
     ui->label_alpha_end->setText(QString::number(rad_to_deg(alpha_end), 'f', 1) + "°");
 
-    // Убираем предыдущий график
+    // Убираем предыдущий график (удаление серии возвращает ее буфер траектории в пул)
     if (! ui->btn_fixed->isChecked()){
         for (auto ser : chart->seriesList()){
             chart->removeSeries(ser);
+            delete ser;
         }
     } else {
         chart->seriesList().at(0)->setBaseColor(Qt::green);
     }
+    preview_series = nullptr; // при фиксации предпросмотр остается на графике
 
-    // Добавляем точки
+    // Добавляем точки (копия массива разделяет данные с буфером, сами точки не копируются)
     series = new QScatter3DSeries;
-    series->dataProxy()->addItems(result.data);
+    series->dataProxy()->resetArray(new QScatterDataArray(result.data));
     series->setBaseColor(Qt::red);
     series->setSingleHighlightColor(Qt::green);
     chart->addSeries(series);
@@ -110,23 +127,7 @@ void MainWindow::start(bool from_gui_inputs){
     animation_launched += 1;
     QTimer::singleShot(50, this, [this]() { animation(); } );
 
-    // Добавляем точку старта на график отдельным цветом
-    start_point = new QScatter3DSeries;
-    QScatterDataArray start_p_data;
-    start_p_data << QVector3D(0.0, h0, 0.0);
-    start_point->setBaseColor(Qt::black);
-    start_point->setItemSize(series->itemSize()*1.2f);
-    start_point->dataProxy()->addItems(start_p_data);
-    chart->addSeries(start_point);
-
-    // Добавляем точку цели на график отдельным цветом
-    target_point = new QScatter3DSeries;
-    QScatterDataArray target_p_data;
-    target_p_data << QVector3D(target_x, target_h, target_y);
-    target_point->setBaseColor(Qt::darkRed);
-    target_point->setItemSize(series->itemSize()*1.2f);
-    target_point->dataProxy()->addItems(target_p_data);
-    chart->addSeries(target_point);
+    add_markers(series->itemSize()*1.2f);
 
     // Настраиваем оси и показываем график
     float new_range = std::max(std::max(abs(end.x), abs(end.y)), abs(result.z_max));
@@ -147,6 +148,26 @@ void MainWindow::start(bool from_gui_inputs){
     chart->show();
 }
 
+// Точки старта и цели отдельными цветами (с рельефом высоты отсчитываются от земли в точке стрельбы)
+void MainWindow::add_markers(float item_size)
+{
+    start_point = new QScatter3DSeries;
+    QScatterDataArray start_p_data;
+    start_p_data << QVector3D(0.0, h0 + ground_level(terrain.get()), 0.0);
+    start_point->setBaseColor(Qt::black);
+    start_point->setItemSize(item_size);
+    start_point->dataProxy()->addItems(start_p_data);
+    chart->addSeries(start_point);
+
+    target_point = new QScatter3DSeries;
+    QScatterDataArray target_p_data;
+    target_p_data << QVector3D(target_x, target_h + ground_level(terrain.get()), target_y);
+    target_point->setBaseColor(Qt::darkRed);
+    target_point->setItemSize(item_size);
+    target_point->dataProxy()->addItems(target_p_data);
+    chart->addSeries(target_point);
+}
+
 void MainWindow::animation()
 {
     if (animation_counter > series->dataProxy()->itemCount() || animation_launched > 1 || grid_mode){
@@ -163,24 +184,44 @@ void MainWindow::animation()
 float MainWindow::get_alpha(){return anchor_alpha + ui->edt_alpha->value()*step_alpha;}
 float MainWindow::get_beta(){return anchor_beta + ui->edt_beta->value()*step_beta;}
 float MainWindow::get_gamma(){return anchor_gamma + ui->edt_gamma->value()*step_gamma;}
+// Шаг интегрирования должен быть положительным, иначе расчет не закончится
+bool MainWindow::check_dt(){
+    if (dt > 0){return true;}
+    QMessageBox::warning(this, "Параметры", "Шаг по времени dt должен быть больше нуля");
+    return false;
+}
+// Высота окончания полета: высота цели или земля (с рельефом - сам рельеф, поэтому плоскость отключается)
+float MainWindow::get_h_end(){
+    if (ui->btn_is_user_h->isChecked()){return target_h;}
+    return (terrain != nullptr) ? -INFINITY : 0.0f;
+}
+// Постоянный закон (индекс 0) считается по прежней формуле без таблицы
+const DragCurve *MainWindow::get_drag(){
+    int index = ui->edt_drag->currentIndex();
+    if (index <= 0 || index >= int(drag_curves.size())){return nullptr;}
+    return &drag_curves[index];
+}
 
 
 void MainWindow::on_edt_alpha_valueChanged()
 {
     ui->label_alpha->setText("Угол вертикальной наводки: (" + QString::number(get_alpha()) + "°)");
     //std::cout << anchor_alpha << " " << step_alpha << std::endl;
+    if (ui->btn_live->isChecked() && !preview_timer->isActive()){preview_timer->start();}
 }
 
 
 void MainWindow::on_edt_beta_valueChanged()
 {
     ui->label_beta->setText("Угол горизонтальной наводки: (" + QString::number(get_beta()) + "°)");
+    if (ui->btn_live->isChecked() && !preview_timer->isActive()){preview_timer->start();}
 }
 
 
 void MainWindow::on_edt_gamma_valueChanged()
 {
     ui->label_gamma->setText("Направление ветра: (" + QString::number(get_gamma()) + "°)");
+    if (ui->btn_live->isChecked() && !preview_timer->isActive()){preview_timer->start();}
 }
 
 
@@ -257,12 +298,13 @@ void MainWindow::on_pushButton_optimal_clicked()
         m = params_list[7].toFloat();
         dt = params_list[8].toFloat();
     }
+    if (!check_dt()){
+        return;
+    }
     target_x = ui->edt_target_x->text().toFloat();
     target_y = ui->edt_target_y->text().toFloat();
     target_h = ui->edt_target_h->text().toFloat();
-    if (ui->btn_is_user_h->isChecked()){
-        h_end = target_h;
-    }
+    h_end = get_h_end();
     Vec u = Vec(u_value, 0.0, gamma);
 
     ui->progressBar->setValue(0); // progressBar
@@ -274,6 +316,8 @@ void MainWindow::on_pushButton_optimal_clicked()
     ep.u = u;
     ep.h0 = h0;
     ep.h_end = h_end;
+    ep.terrain = terrain.get();
+    ep.drag = get_drag();
 
     grad_params gp;
     gp.da = ui->edt_da->text().toFloat();
@@ -299,6 +343,8 @@ void MainWindow::on_pushButton_optimal_clicked()
 
 void MainWindow::on_btn_grid_clicked()
 {
+    cancel_coverage();
+    cancel_preview();
     grid_mode = true;
     target_x = ui->edt_target_x->text().toFloat();
     target_y = ui->edt_target_y->text().toFloat();
@@ -327,22 +373,20 @@ void MainWindow::on_btn_grid_clicked()
         m = params_list[7].toFloat();
         dt = params_list[8].toFloat();
     }
+    if (!check_dt()){
+        return;
+    }
 
     Vec v = Vec(v0, alpha, beta);
     Vec u = Vec(u_value, 0.0, gamma);
 
-    float h_end;
-    if (ui->btn_is_user_h->isChecked()){
-        h_end = target_h;
-    } else{
-        h_end = 0.0f;
-    }
+    float h_end = get_h_end();
 
     ui->progressBar->setValue(10); // progressBar
 
     // float alpha_min, float alpha_max, float beta_min, float beta_max, float angle_step, float v0, P target, ext_params ep
-    QScatterDataArray grid = grid_target_error(deg_to_rad(1.0), deg_to_rad(90.0), -deg_to_rad(90.0), deg_to_rad(90.0), deg_to_rad(0.5), v0, P{target_x, target_y, target_h}, ext_params{u, mu, m, dt, h0, h_end});
-    // struct ext_params{Vec u;float mu;float m;float dt;float h0;float h_end;};
+    QScatterDataArray grid = grid_target_error(deg_to_rad(1.0), deg_to_rad(90.0), -deg_to_rad(90.0), deg_to_rad(90.0), deg_to_rad(0.5), v0, P{target_x, target_y, target_h}, ext_params{u, mu, m, dt, h0, h_end, terrain.get(), get_drag()});
+    // struct ext_params{Vec u;float mu;float m;float dt;float h0;float h_end;const Terrain *terrain;const DragCurve *drag;};
 
 
     ui->progressBar->setValue(90); // progressBar
@@ -351,10 +395,12 @@ void MainWindow::on_btn_grid_clicked()
     if (! ui->btn_fixed->isChecked()){
         for (auto ser : chart->seriesList()){
             chart->removeSeries(ser);
+            delete ser;
         }
     } else {
         chart->seriesList().at(0)->setBaseColor(Qt::green);
     }
+    preview_series = nullptr;
 
     // Добавляем точки
     series = new QScatter3DSeries;
@@ -375,3 +421,282 @@ void MainWindow::on_btn_grid_clicked()
     chart->show();
 }
 
+
+// Загрузка рельефа (ЦМР). Повторное нажатие при загруженном рельефе возвращает плоскую землю
+void MainWindow::on_btn_terrain_clicked()
+{
+    if (terrain != nullptr){
+        terrain.reset();
+        ui->btn_terrain->setText("dem");
+        return;
+    }
+    QString path = QFileDialog::getOpenFileName(this, "Рельеф местности", QString(), "ЦМР (*.dem *.raw);;Все файлы (*)");
+    if (path.isEmpty()){
+        return;
+    }
+    std::shared_ptr<Terrain> loaded = std::make_shared<Terrain>();
+    if (!loaded->load(path)){
+        QMessageBox::warning(this, "Рельеф местности", "Не удалось загрузить файл рельефа");
+        return;
+    }
+    terrain = loaded;
+    ui->btn_terrain->setText("flat");
+}
+
+
+// Выбор закона сопротивления; пункт "Из файла..." загружает кривую Cd(Мах) из текстового файла
+void MainWindow::on_edt_drag_activated(int index)
+{
+    if (index < int(drag_curves.size())){
+        drag_index = index;
+        return;
+    }
+    QString path = QFileDialog::getOpenFileName(this, "Закон сопротивления", QString(), "Кривая Cd(Мах) (*.txt *.csv);;Все файлы (*)");
+    DragCurve curve;
+    if (path.isEmpty() || !DragCurve::from_file(path, curve)){
+        if (!path.isEmpty()){
+            QMessageBox::warning(this, "Закон сопротивления", "Не удалось загрузить кривую сопротивления");
+        }
+        ui->edt_drag->setCurrentIndex(drag_index);
+        return;
+    }
+    drag_curves.push_back(curve);
+    ui->edt_drag->insertItem(index, curve.name);
+    ui->edt_drag->setCurrentIndex(index);
+    drag_index = index;
+}
+
+
+// Зона досягаемости: контур максимальной дальности по всем азимутам и карта досягаемости с мертвыми зонами
+void MainWindow::on_btn_coverage_clicked()
+{
+    cancel_preview();
+    grid_mode = true;
+
+    // Два способа ввода начальных данных: через пользовательский ввод и через специальную строку параметров (больше точность)
+    if (!ui->btn_optres->isChecked()){
+        h0 = ui->edt_h0->text().toFloat();
+        v0 = ui->edt_v0->text().toFloat();
+        u_value = ui->edt_u->text().toFloat();
+        gamma = deg_to_rad(get_gamma());
+        mu = ui->edt_mu->text().toFloat();
+        m = ui->edt_m->text().toFloat();
+        dt = ui->edt_dt->text().toFloat();
+    } else {
+        QStringList params_list = ui->edt_optres->text().split(";");
+        h0 = params_list[0].toFloat();
+        v0 = params_list[1].toFloat();
+        u_value = params_list[4].toFloat();
+        gamma = deg_to_rad(params_list[5].toFloat());
+        mu = params_list[6].toFloat();
+        m = params_list[7].toFloat();
+        dt = params_list[8].toFloat();
+    }
+    if (!check_dt()){
+        return;
+    }
+
+    Vec u = Vec(u_value, 0.0, gamma);
+    ext_params ep{u, mu, m, dt, h0, (terrain != nullptr) ? -INFINITY : 0.0f, terrain.get(), get_drag()};
+    std::shared_ptr<Terrain> ter = terrain; // фоновый расчет держит рельеф, даже если его выгрузят
+    float v0_ = v0;
+
+    ui->progressBar->setValue(0); // progressBar
+
+    // Расчет в фоне; повторное нажатие отменяет предыдущий расчет
+    int generation = ++coverage_generation;
+    coverage_worker.post([this, ep, ter, v0_, generation](const std::atomic<bool> &cancel){
+        // 360 азимутов через 1°, углы возвышения от 1° до 89° через 2° (максимум уточняется отдельно)
+        std::shared_ptr<coverage_return> cov = std::make_shared<coverage_return>(
+            coverage(360, deg_to_rad(1.0), deg_to_rad(89.0), deg_to_rad(2.0), v0_, ep,
+                     [this, generation](int procents){
+                         QMetaObject::invokeMethod(this, [this, procents, generation]() {
+                             if (generation == coverage_generation){progress(procents);} // прогресс отмененного расчета не показываем
+                         }, Qt::QueuedConnection);
+                     },
+                     &cancel));
+        if (cancel){
+            return;
+        }
+        QMetaObject::invokeMethod(this, [this, cov, generation]() { show_coverage(cov, generation); }, Qt::QueuedConnection);
+    });
+}
+
+void MainWindow::show_coverage(std::shared_ptr<coverage_return> cov, int generation)
+{
+    if (generation != coverage_generation){
+        return; // результат отмененного расчета
+    }
+
+    // Убираем предыдущий график
+    for (auto ser : chart->seriesList()){
+        chart->removeSeries(ser);
+        delete ser;
+    }
+    preview_series = nullptr;
+
+    // Карта досягаемости: досягаемые ячейки и мертвые зоны (внутри контура, но недосягаемые)
+    QScatterDataArray reach_cells, dead_cells;
+    for (int cy = 0; cy < cov->cells; cy++){
+        for (int cx = 0; cx < cov->cells; cx++){
+            unsigned char c = cov->heatmap[size_t(cy)*cov->cells + cx];
+            float x = (cx + 0.5f - cov->cells/2.0f)*cov->cell;
+            float y = (cy + 0.5f - cov->cells/2.0f)*cov->cell;
+            float z = (terrain != nullptr) ? terrain->height_at(x, y) : 0.0f;
+            if (c == 1){reach_cells << QVector3D(x, z, y);} // Особенности Q3DScatter (y -> z)
+            if (c == 2){dead_cells << QVector3D(x, z, y);}
+        }
+    }
+    series = new QScatter3DSeries;
+    series->dataProxy()->resetArray(new QScatterDataArray(reach_cells));
+    series->setBaseColor(Qt::green);
+    series->setItemSize(0.03f);
+    chart->addSeries(series);
+
+    QScatter3DSeries *dead = new QScatter3DSeries;
+    dead->dataProxy()->resetArray(new QScatterDataArray(dead_cells));
+    dead->setBaseColor(Qt::darkGray);
+    dead->setItemSize(0.03f);
+    chart->addSeries(dead);
+
+    // Контур максимальной дальности
+    QScatter3DSeries *envelope = new QScatter3DSeries;
+    envelope->dataProxy()->resetArray(new QScatterDataArray(cov->envelope));
+    envelope->setBaseColor(Qt::red);
+    envelope->setItemSize(0.05f);
+    chart->addSeries(envelope);
+
+    // Точка старта
+    start_point = new QScatter3DSeries;
+    QScatterDataArray start_p_data;
+    start_p_data << QVector3D(0.0, h0 + ground_level(terrain.get()), 0.0); // с рельефом h0 - над землей
+    start_point->setBaseColor(Qt::black);
+    start_point->dataProxy()->addItems(start_p_data);
+    chart->addSeries(start_point);
+
+    // Настраиваем оси и показываем график
+    range = *std::max_element(cov->max_range.begin(), cov->max_range.end());
+    chart->axisX()->setRange(-range, range);
+    chart->axisY()->setRange(0, range);
+    chart->axisZ()->setRange(-range, range);
+    chart->setAspectRatio(2);
+    chart->setHorizontalAspectRatio(1);
+
+    float min_range = *std::min_element(cov->min_range.begin(), cov->min_range.end());
+    ui->label_distance->setText(QString::number(min_range, 'f', 1) + " - " + QString::number(range, 'f', 1));
+    ui->progressBar->setValue(100); // progressBar
+
+    chart->show();
+}
+
+// Отмена фонового расчета зоны досягаемости (его результат больше не нужен)
+void MainWindow::cancel_coverage()
+{
+    ++coverage_generation;
+    coverage_worker.post([](const std::atomic<bool> &){});
+}
+
+
+// Предпросмотр траектории при движении ползунков: в фоне сначала грубый расчет (не больше ~500 шагов),
+// затем уточнение с исходным dt. Устаревшие фоновые расчеты отменяются
+void MainWindow::preview()
+{
+    h0 = ui->edt_h0->text().toFloat();
+    v0 = ui->edt_v0->text().toFloat();
+    alpha = deg_to_rad(get_alpha());
+    beta = deg_to_rad(get_beta());
+    u_value = ui->edt_u->text().toFloat();
+    gamma = deg_to_rad(get_gamma());
+    mu = ui->edt_mu->text().toFloat();
+    m = ui->edt_m->text().toFloat();
+    dt = ui->edt_dt->text().toFloat();
+    target_x = ui->edt_target_x->text().toFloat();
+    target_y = ui->edt_target_y->text().toFloat();
+    target_h = ui->edt_target_h->text().toFloat();
+    if (!(dt > 0)){
+        return;
+    }
+
+    Vec v = Vec(v0, alpha, beta);
+    Vec u = Vec(u_value, 0.0, gamma);
+    float h_end = get_h_end();
+    std::shared_ptr<Terrain> ter = terrain; // фоновый расчет держит рельеф, даже если его выгрузят
+    const DragCurve *drag = get_drag();
+
+    cancel_coverage();
+    int generation = ++preview_generation;
+    float dt_coarse = std::max(dt, estimate_flight_time(v.to_avec().z, h0, h_end)/500);
+
+    // Оба прохода считаются в фоне, поэтому работа с рельефом не задерживает интерфейс.
+    // Поля окна копируются: фоновый поток не должен читать их во время следующего изменения
+    float mu_ = mu, m_ = m, dt_ = dt, h0_ = h0;
+    preview_worker.post([this, v, u, mu_, m_, dt_, dt_coarse, h0_, h_end, ter, drag, generation](const std::atomic<bool> &cancel){
+        for (float step : {dt_coarse, dt_}){
+            Simulation sim = compute(v, u, mu_, m_, step, h0_, h_end, ter.get(), drag, &cancel);
+            if (cancel){
+                return;
+            }
+            QScatterDataArray data = sim.data; // разделяет данные с буфером потока, без копирования точек
+            float z_max = sim.z_max;
+            QMetaObject::invokeMethod(this, [this, data, z_max, generation]() { show_preview(data, z_max, generation); }, Qt::QueuedConnection);
+            if (dt_coarse <= dt_){
+                return; // грубый проход уже с исходным шагом
+            }
+        }
+    });
+}
+
+// Отмена предпросмотра: устаревшее уточнение не должно затереть построенный график
+void MainWindow::cancel_preview()
+{
+    preview_timer->stop();
+    ++preview_generation;
+    preview_worker.post([](const std::atomic<bool> &){});
+}
+
+void MainWindow::on_btn_live_toggled(bool checked)
+{
+    if (checked){
+        preview_timer->start(); // сразу строим предпросмотр текущих параметров
+    } else {
+        cancel_preview();
+    }
+}
+
+void MainWindow::show_preview(const QScatterDataArray &data, float z_max, int generation)
+{
+    if (generation != preview_generation || data.isEmpty()){
+        return; // результат устаревшего расчета
+    }
+    if (preview_series == nullptr){
+        // Как в start(): при фиксации прошлые траектории остаются на графике
+        if (! ui->btn_fixed->isChecked()){
+            for (auto ser : chart->seriesList()){
+                chart->removeSeries(ser);
+                delete ser;
+            }
+        } else if (!chart->seriesList().isEmpty()){
+            chart->seriesList().at(0)->setBaseColor(Qt::green);
+        }
+        grid_mode = true; // останавливаем анимацию прошлого расчета
+        preview_series = new QScatter3DSeries;
+        preview_series->setBaseColor(Qt::red);
+        chart->addSeries(preview_series);
+        series = preview_series;
+        add_markers(preview_series->itemSize()*1.2f);
+    }
+    preview_series->dataProxy()->resetArray(new QScatterDataArray(data));
+
+    P end = P(data.back().x(), data.back().z(), data.back().y());
+    ui->label_end->setText("(" + QString::number(end.x, 'f', 1) + ", " + QString::number(end.y, 'f', 1) + ")");
+    ui->label_distance->setText(QString::number(end.distance_xy(P()), 'f', 1));
+    ui->label_max_h->setText(QString::number(z_max, 'f', 1));
+
+    float new_range = std::max(std::max(std::abs(end.x), std::abs(end.y)), std::abs(z_max));
+    if (new_range > range){ // оси только расширяем, чтобы график не прыгал при движении ползунков
+        range = new_range;
+        chart->axisX()->setRange(-range, range);
+        chart->axisY()->setRange(0, range);
+        chart->axisZ()->setRange(0, range);
+    }
+}
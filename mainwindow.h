@@ -3,11 +3,20 @@
 
 #include <QMainWindow>
 #include <Q3DScatter>
+#include <deque>
+#include <memory>
+#include "drag.h"
+#include "worker.h"
+
+class QTimer;
+struct coverage_return;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
 QT_END_NAMESPACE
 
+class Terrain;
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -25,13 +34,31 @@ public:
     bool grid_mode=false;
     Q3DScatter *chart;
     QScatter3DSeries *series = new QScatter3DSeries, *start_point = new QScatter3DSeries, *target_point = new QScatter3DSeries;
+    std::shared_ptr<Terrain> terrain; // загруженный рельеф (nullptr - плоская земля)
+    std::deque<DragCurve> drag_curves; // законы сопротивления, по индексу совпадают с edt_drag (deque - адреса не меняются)
+    int drag_index = 0; // последний выбранный закон (для отмены загрузки из файла)
+    QTimer *preview_timer; // объединяет изменения ползунков: не больше одного пересчета за 16 мс
+    QScatter3DSeries *preview_series = nullptr;
+    int preview_generation = 0;
+    LatestJobWorker preview_worker; // грубый проход и уточнение предпросмотра с исходным dt
+    int coverage_generation = 0;
+    LatestJobWorker coverage_worker; // расчет зоны досягаемости, не блокирует интерфейс
 
     void start(bool);
+    void add_markers(float item_size);
     void animation();
     float get_alpha();
     float get_beta();
     float get_gamma();
+    const DragCurve *get_drag();
+    float get_h_end();
+    bool check_dt();
     void progress(int);
+    void preview();
+    void show_preview(const QScatterDataArray &data, float z_max, int generation);
+    void cancel_preview();
+    void show_coverage(std::shared_ptr<coverage_return> cov, int generation);
+    void cancel_coverage();
 
 private slots:
     void on_pushButton_start_clicked();
@@ -52,6 +79,14 @@ private slots:
 
     void on_btn_grid_clicked();
 
+    void on_btn_terrain_clicked();
+
+    void on_edt_drag_activated(int index);
+
+    void on_btn_coverage_clicked();
+
+    void on_btn_live_toggled(bool checked);
+
 private:
     Ui::MainWindow *ui;
 };
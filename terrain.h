@@ -0,0 +1,202 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <QFile>
+#include <QString>
+
+// Цифровая модель рельефа (ЦМР) в виде регулярной сетки высот.
+// Формат файла: заголовок (int32 width, int32 height, float cell, float x0, float y0),
+// затем width*height высот float32 по строкам (строка - фиксированный y).
+// Файл отображается в память (QFile::map): при загрузке высоты читаются один раз для пирамиды
+// максимумов, в куче хранится только она (~1/256 размера ЦМР), а не сама сетка.
+// Вне сетки рельеф считается плоским с высотой 0 (как и раньше).
+class Terrain{
+public:
+    Terrain() = default;
+    ~Terrain(){close();}
+    Terrain(const Terrain&) = delete;
+    Terrain& operator=(const Terrain&) = delete;
+
+    bool load(const QString &path){
+        close();
+        file.setFileName(path);
+        if (!file.open(QIODevice::ReadOnly) || file.size() < qint64(header_size)){
+            close();
+            return false;
+        }
+        map = file.map(0, file.size());
+        if (map == nullptr){
+            close();
+            return false;
+        }
+        qint32 w, h;
+        memcpy(&w, map, 4);
+        memcpy(&h, map + 4, 4);
+        memcpy(&cell, map + 8, 4);
+        memcpy(&x0, map + 12, 4);
+        memcpy(&y0, map + 16, 4);
+        // Размеры ограничены до проверки длины файла, чтобы произведение не переполнилось
+        if (w <= 0 || h <= 0 || w > max_side || h > max_side || !(cell > 0) ||
+            file.size() < qint64(header_size) + qint64(w)*h*4){
+            close();
+            return false;
+        }
+        width = w;
+        height = h;
+        heights = reinterpret_cast<const float*>(map + header_size);
+        build_pyramid();
+        return true;
+    }
+
+    void close(){
+        if (map != nullptr){
+            file.unmap(map);
+            map = nullptr;
+        }
+        file.close();
+        heights = nullptr;
+        width = height = 0;
+        levels.clear();
+        h_min = 0;
+    }
+
+    bool is_loaded() const {return heights != nullptr;}
+
+    // Минимальная высота рельефа (с учетом плоскости z = 0 вне сетки)
+    float min_height() const {return h_min;}
+
+    // Высота рельефа в точке (билинейная интерполяция)
+    float height_at(float x, float y) const {
+        float gx = (x - x0)/cell, gy = (y - y0)/cell;
+        if (!(gx >= 0 && gy >= 0 && gx <= width - 1 && gy <= height - 1)){
+            return 0.0f;
+        }
+        int i = std::min(int(gx), std::max(width - 2, 0));
+        int j = std::min(int(gy), std::max(height - 2, 0));
+        float fx = gx - i, fy = gy - j;
+        float h00 = h(i, j), h10 = h(std::min(i+1, width-1), j);
+        float h01 = h(i, std::min(j+1, height-1)), h11 = h(std::min(i+1, width-1), std::min(j+1, height-1));
+        return (h00*(1-fx) + h10*fx)*(1-fy) + (h01*(1-fx) + h11*fx)*fy;
+    }
+
+    // Пересечение отрезка a-b с рельефом. Возвращает true и параметр t в [0, 1] первой точки касания.
+    // Пока отрезок выше максимума высот в своей окрестности (по пирамиде максимумов),
+    // точная проверка не выполняется
+    bool intersect(float ax, float ay, float az, float bx, float by, float bz, float &t) const {
+        if (std::min(az, bz) > max_in_box(std::min(ax, bx), std::min(ay, by), std::max(ax, bx), std::max(ay, by))){
+            return false;
+        }
+        // Точная проверка: шаг не больше половины ячейки, затем бисекция
+        float len = std::max(std::abs(bx - ax), std::abs(by - ay));
+        int n = std::max(1, int(std::ceil(2*len/cell)));
+        float t_prev = 0;
+        for (int k = 1; k <= n; k++){
+            float tk = float(k)/n;
+            if (az + (bz - az)*tk - height_at(ax + (bx - ax)*tk, ay + (by - ay)*tk) <= 0){
+                float lo = t_prev, hi = tk;
+                for (int it = 0; it < 20; it++){
+                    float mid = (lo + hi)/2;
+                    if (az + (bz - az)*mid - height_at(ax + (bx - ax)*mid, ay + (by - ay)*mid) <= 0){
+                        hi = mid;
+                    } else {
+                        lo = mid;
+                    }
+                }
+                t = hi;
+                return true;
+            }
+            t_prev = tk;
+        }
+        return false;
+    }
+
+private:
+    static const int header_size = 20;
+    static const int max_side = 1 << 20;
+    static const int block_shift = 4; // нижний уровень пирамиды - блоки 16x16 ячеек
+    QFile file;
+    uchar *map = nullptr;
+    const float *heights = nullptr;
+    int width = 0, height = 0;
+    float cell = 1, x0 = 0, y0 = 0;
+    float h_min = 0;
+    // levels[l] - максимумы высот по блокам 2^(block_shift+l) x 2^(block_shift+l) ячеек.
+    // В памяти хранится ~1/256 размера ЦМР, сами высоты читаются из отображенного файла
+    struct Level{
+        int w, h;
+        std::vector<float> max;
+    };
+    std::vector<Level> levels;
+
+    float h(int i, int j) const {return heights[size_t(j)*width + i];}
+
+    float level_max(int l, int i, int j) const {
+        const Level &lv = levels[l];
+        return lv.max[size_t(j)*lv.w + i];
+    }
+
+    // Один проход по сетке: максимумы блоков нижнего уровня и минимум высот, затем верхние уровни
+    void build_pyramid(){
+        const int b = 1 << block_shift;
+        Level base;
+        base.w = (width + b - 1) >> block_shift;
+        base.h = (height + b - 1) >> block_shift;
+        base.max.assign(size_t(base.w)*base.h, -INFINITY);
+        h_min = 0.0f; // плоскость вне сетки
+        for (int j = 0; j < height; j++){
+            float *row = &base.max[size_t(j >> block_shift)*base.w];
+            for (int i = 0; i < width; i++){
+                float z = h(i, j);
+                row[i >> block_shift] = std::max(row[i >> block_shift], z);
+                h_min = std::min(h_min, z);
+            }
+        }
+        levels.push_back(std::move(base));
+        while (levels.back().w > 1 || levels.back().h > 1){
+            const Level &prev = levels.back();
+            Level lv;
+            lv.w = (prev.w + 1)/2;
+            lv.h = (prev.h + 1)/2;
+            lv.max.assign(size_t(lv.w)*lv.h, -INFINITY);
+            for (int j = 0; j < prev.h; j++){
+                for (int i = 0; i < prev.w; i++){
+                    float &m = lv.max[size_t(j/2)*lv.w + i/2];
+                    m = std::max(m, prev.max[size_t(j)*prev.w + i]);
+                }
+            }
+            levels.push_back(std::move(lv));
+        }
+    }
+
+    // Оценка сверху для высоты рельефа в прямоугольнике: поднимаемся по пирамиде
+    // до уровня, на котором прямоугольник покрывается не более чем 2x2 блоками
+    float max_in_box(float xa, float ya, float xb, float yb) const {
+        float ga = (xa - x0)/cell, gb = (xb - x0)/cell;
+        float gc = (ya - y0)/cell, gd = (yb - y0)/cell;
+        bool outside = ga < 0 || gc < 0 || gb > width - 1 || gd > height - 1;
+        float m = outside ? 0.0f : -INFINITY;
+        if (gb < 0 || gd < 0 || ga > width - 1 || gc > height - 1){
+            return m; // прямоугольник целиком вне сетки
+        }
+        int i0 = std::max(int(ga), 0), i1 = std::min(int(gb) + 1, width - 1);
+        int j0 = std::max(int(gc), 0), j1 = std::min(int(gd) + 1, height - 1);
+        int l = 0;
+        while (l + 1 < int(levels.size()) &&
+               ((i1 >> (block_shift + l)) - (i0 >> (block_shift + l)) > 1 || (j1 >> (block_shift + l)) - (j0 >> (block_shift + l)) > 1)){
+            l++;
+        }
+        int s = block_shift + l;
+        for (int j = j0 >> s; j <= j1 >> s; j++){
+            for (int i = i0 >> s; i <= i1 >> s; i++){
+                m = std::max(m, level_max(l, i, j));
+            }
+        }
+        return m;
+    }
+};
+
+#endif // TERRAIN_H
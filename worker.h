@@ -0,0 +1,64 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Фоновый поток, который выполняет только последнее поставленное задание.
+// Новое задание заменяет ожидающее и выставляет флаг отмены выполняемому
+// (задание должно периодически проверять переданный ему флаг)
+class LatestJobWorker{
+public:
+    typedef std::function<void(const std::atomic<bool>&)> Job;
+
+    LatestJobWorker() : thread([this]{run();}) {}
+    ~LatestJobWorker(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+            cancel = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+    LatestJobWorker(const LatestJobWorker&) = delete;
+    LatestJobWorker& operator=(const LatestJobWorker&) = delete;
+
+    void post(Job job){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = job;
+            cancel = true;
+        }
+        cv.notify_one();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    Job pending;
+    std::atomic<bool> cancel{false};
+    bool stop = false;
+    std::thread thread; // объявлен последним: запускается после инициализации остальных полей
+
+    void run(){
+        for (;;){
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]{return stop || pending;});
+                if (stop){
+                    return;
+                }
+                job.swap(pending);
+                cancel = false;
+            }
+            job(cancel);
+        }
+    }
+};
+
+#endif // WORKER_H